@@ -0,0 +1,5 @@
+// depth prepass - color writes are masked off, we only want the depth buffer
+void main()
+{
+    gl_FragColor = vec4(1.0);
+}
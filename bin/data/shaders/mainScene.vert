@@ -15,5 +15,6 @@ void main(void)
     
 	v_VertInLightSpace = u_ShadowTransMatrix * vertInViewSpace;
 
-	gl_Position = gl_ModelViewProjectionMatrix * gl_Vertex;
+	// ftransform() so positions are invariant with the depth prepass (linearDepthBuffer.vert) for GL_EQUAL depth testing
+	gl_Position = ftransform();
 }
@@ -0,0 +1,301 @@
+//  Profiler.cpp
+//
+//  Lightweight CPU scope profiler - see Profiler.h for usage
+
+#include "profiler.h"
+
+#include <algorithm>
+#include <iomanip>
+
+struct Profiler::ThreadBuffer {
+    Event               events[s_bufferSize];
+    volatile uint32_t   writeIndex; // total events written, wraps naturally
+    uint32_t            threadId;
+
+    ThreadBuffer( uint32_t threadId ) : writeIndex(0), threadId(threadId) {}
+};
+
+namespace {
+#ifdef __APPLE__
+    mach_timebase_info_data_t getTimebase() {
+        mach_timebase_info_data_t timebase;
+        mach_timebase_info( &timebase );
+        return timebase;
+    }
+#endif
+}
+
+volatile bool           Profiler::s_bEnabled = false;
+volatile uint32_t       Profiler::s_frame = 0;
+
+#ifdef __APPLE__
+mach_timebase_info_data_t Profiler::s_timebase = getTimebase();
+#endif
+
+pthread_key_t           Profiler::s_threadKey;
+pthread_once_t          Profiler::s_threadKeyOnce = PTHREAD_ONCE_INIT;
+pthread_mutex_t         Profiler::s_registryMutex = PTHREAD_MUTEX_INITIALIZER;
+vector<Profiler::ThreadBuffer*> Profiler::s_threadBuffers;
+
+namespace {
+    // json strings - zone names are normally plain literals, but don't break the file if they aren't
+    string escapeJson( const char* str ) {
+        string out;
+        for ( const char* c=str; *c; c++ ) {
+            if ( *c == '"' || *c == '\\' ) {
+                out += '\\';
+                out += *c;
+            } else if ( (unsigned char)*c < 0x20 ) {
+                out += ' ';
+            } else {
+                out += *c;
+            }
+        }
+        return out;
+    }
+
+    struct ZoneStats {
+        string  name;
+        size_t  count;
+        double  total;
+        double  mean;
+        double  p50;
+        double  p95;
+        double  p99;
+        double  max;
+
+        bool operator<( const ZoneStats &other ) const {
+            return total > other.total; // most expensive first
+        }
+    };
+
+    // nearest rank percentile on sorted durations (nanoseconds in, microseconds out)
+    double percentile( const vector<uint64_t> &sorted, double p ) {
+        size_t rank = (size_t)ceil( p * sorted.size() );
+        rank = rank > 0 ? rank - 1 : 0;
+        rank = MIN( rank, sorted.size() - 1 );
+        return sorted[rank] / 1000.0;
+    }
+}
+
+void Profiler::setEnabled( bool enabled ) {
+    s_bEnabled = enabled;
+}
+
+void Profiler::beginFrame() {
+    s_frame = s_frame + 1;
+}
+
+void Profiler::createThreadKey() {
+    // buffers are never freed - events from threads that have exited can still be dumped
+    pthread_key_create( &s_threadKey, NULL );
+}
+
+Profiler::ThreadBuffer* Profiler::getThreadBuffer() {
+    pthread_once( &s_threadKeyOnce, createThreadKey );
+
+    ThreadBuffer* buffer = (ThreadBuffer*)pthread_getspecific( s_threadKey );
+
+    if ( buffer == NULL ) {
+        // first zone on this thread - register a new buffer
+        pthread_mutex_lock( &s_registryMutex );
+        buffer = new ThreadBuffer( s_threadBuffers.size() );
+        s_threadBuffers.push_back( buffer );
+        pthread_mutex_unlock( &s_registryMutex );
+
+        pthread_setspecific( s_threadKey, buffer );
+    }
+
+    return buffer;
+}
+
+void Profiler::leaveZone( ThreadBuffer* buffer, const char* name, uint64_t start ) {
+    uint64_t end = now();
+
+    uint32_t index = buffer->writeIndex;
+
+    Event &e = buffer->events[ index & (s_bufferSize - 1) ];
+    e.name = name;
+    e.start = start;
+    e.end = end;
+    e.frame = s_frame;
+
+    // make sure the event is written before it's published to a reader on another thread
+    __sync_synchronize();
+    buffer->writeIndex = index + 1;
+}
+
+void Profiler::collectEvents( vector<Event> &events, vector<uint32_t> &threadIds, uint32_t numFrames ) {
+    uint32_t currentFrame = s_frame;
+
+    pthread_mutex_lock( &s_registryMutex );
+
+    for ( size_t i=0; i<s_threadBuffers.size(); i++ ) {
+        ThreadBuffer* buffer = s_threadBuffers[i];
+
+        uint32_t last = buffer->writeIndex;
+        __sync_synchronize();
+        uint32_t first = last > s_bufferSize ? last - s_bufferSize : 0;
+
+        size_t startSize = events.size();
+        for ( uint32_t j=first; j<last; j++ ) {
+            events.push_back( buffer->events[ j & (s_bufferSize - 1) ] );
+            threadIds.push_back( buffer->threadId );
+        }
+
+        // the owning thread may have lapped us while copying - drop anything it could have overwritten.
+        // the slot of the next unpublished event (index writeIndex) is also in flight
+        __sync_synchronize();
+        uint32_t latest = buffer->writeIndex;
+        uint32_t firstValid = latest + 1 > s_bufferSize ? latest + 1 - s_bufferSize : 0;
+
+        if ( firstValid > first ) {
+            size_t numStale = MIN( firstValid - first, last - first );
+            events.erase( events.begin() + startSize, events.begin() + startSize + numStale );
+            threadIds.erase( threadIds.begin() + startSize, threadIds.begin() + startSize + numStale );
+        }
+    }
+
+    pthread_mutex_unlock( &s_registryMutex );
+
+    if ( numFrames == 0 ) {
+        return;
+    }
+
+    // only keep the most recent frames
+    size_t keep = 0;
+    for ( size_t i=0; i<events.size(); i++ ) {
+        if ( currentFrame - events[i].frame < numFrames ) {
+            events[keep] = events[i];
+            threadIds[keep] = threadIds[i];
+            keep++;
+        }
+    }
+
+    events.resize( keep );
+    threadIds.resize( keep );
+}
+
+bool Profiler::saveChromeTrace( const string &path, uint32_t numFrames ) {
+    vector<Event> events;
+    vector<uint32_t> threadIds;
+
+    collectEvents( events, threadIds, numFrames );
+
+    ofstream file( path.c_str() );
+    if ( !file.is_open() ) {
+        printf("Profiler: could not open %s for writing\n", path.c_str() );
+        return false;
+    }
+
+    // timestamps relative to the oldest event so they stay readable
+    uint64_t baseTime = events.empty() ? 0 : events[0].start;
+    for ( size_t i=0; i<events.size(); i++ ) {
+        baseTime = MIN( baseTime, events[i].start );
+    }
+
+    // chrome trace-event format - "X" are complete events with a start (ts) and duration (dur) in
+    // (fractional) microseconds
+    file << fixed << setprecision(3);
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+    bool bFirst = true;
+    for ( size_t i=0; i<events.size(); i++ ) {
+        const Event &e = events[i];
+
+        if ( !bFirst ) {
+            file << ",\n";
+        }
+        bFirst = false;
+
+        file << "{\"name\":\"" << escapeJson( e.name ) << "\",\"cat\":\"cpu\",\"ph\":\"X\""
+             << ",\"ts\":" << (e.start - baseTime) / 1000.0
+             << ",\"dur\":" << (e.end - e.start) / 1000.0
+             << ",\"pid\":0,\"tid\":" << threadIds[i]
+             << ",\"args\":{\"frame\":" << e.frame << "}}";
+    }
+
+    // name the threads so the main thread is easy to find
+    pthread_mutex_lock( &s_registryMutex );
+    for ( size_t i=0; i<s_threadBuffers.size(); i++ ) {
+        if ( !bFirst ) {
+            file << ",\n";
+        }
+        bFirst = false;
+
+        file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << s_threadBuffers[i]->threadId
+             << ",\"args\":{\"name\":\"thread " << s_threadBuffers[i]->threadId << "\"}}";
+    }
+    pthread_mutex_unlock( &s_registryMutex );
+
+    file << "\n]}\n";
+
+    printf("Profiler: wrote %lu events to %s\n", (unsigned long)events.size(), path.c_str() );
+
+    return true;
+}
+
+string Profiler::getSummary( uint32_t numFrames ) {
+    vector<Event> events;
+    vector<uint32_t> threadIds;
+
+    collectEvents( events, threadIds, numFrames );
+
+    if ( events.empty() ) {
+        return "Profiler: no events recorded\n";
+    }
+
+    // group durations by zone name
+    map<string, vector<uint64_t> > durations;
+    uint32_t minFrame = events[0].frame;
+    uint32_t maxFrame = events[0].frame;
+
+    for ( size_t i=0; i<events.size(); i++ ) {
+        durations[ events[i].name ].push_back( events[i].end - events[i].start );
+        minFrame = MIN( minFrame, events[i].frame );
+        maxFrame = MAX( maxFrame, events[i].frame );
+    }
+
+    vector<ZoneStats> stats;
+    map<string, vector<uint64_t> >::iterator it;
+    for ( it=durations.begin(); it != durations.end(); it++ ) {
+        vector<uint64_t> &sorted = it->second;
+        sort( sorted.begin(), sorted.end() );
+
+        ZoneStats s;
+        s.name = it->first;
+        s.count = sorted.size();
+        s.total = 0.0;
+        for ( size_t i=0; i<sorted.size(); i++ ) {
+            s.total += sorted[i] / 1000.0;
+        }
+        s.mean = s.total / s.count;
+        s.p50 = percentile( sorted, 0.50 );
+        s.p95 = percentile( sorted, 0.95 );
+        s.p99 = percentile( sorted, 0.99 );
+        s.max = sorted.back() / 1000.0;
+
+        stats.push_back( s );
+    }
+
+    sort( stats.begin(), stats.end() );
+
+    uint32_t frameCount = maxFrame - minFrame + 1;
+
+    string summary;
+    char line[256];
+
+    snprintf( line, sizeof(line), "Profiler: %lu events over %u frames (times in us)\n", (unsigned long)events.size(), frameCount );
+    summary += line;
+    snprintf( line, sizeof(line), "%-36s %8s %9s %8s %8s %8s %8s %8s\n", "zone", "calls", "us/frame", "mean", "p50", "p95", "p99", "max" );
+    summary += line;
+
+    for ( size_t i=0; i<stats.size(); i++ ) {
+        const ZoneStats &s = stats[i];
+        snprintf( line, sizeof(line), "%-36s %8lu %9.3f %8.3f %8.3f %8.3f %8.3f %8.3f\n",
+                  s.name.c_str(), (unsigned long)s.count, s.total / frameCount, s.mean, s.p50, s.p95, s.p99, s.max );
+        summary += line;
+    }
+
+    return summary;
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+//  Profiler.h
+//
+//  Lightweight CPU scope profiler. Each thread records completed zones into its own
+//  fixed size ring buffer (single writer, no locks on the hot path). The main thread can
+//  dump whatever is still in the buffers to a Chrome trace-event JSON file (open with
+//  chrome://tracing or ui.perfetto.dev) or print a per-zone percentile summary.
+//
+//  Usage:
+//      void testApp::draw() {
+//          PROFILE_SCOPE("testApp::draw");
+//          ...
+//      }
+//
+//  When the profiler is disabled at runtime a scope costs a single branch. Define
+//  ESM_DISABLE_PROFILER to compile all zones out entirely.
+
+#include "ofMain.h"
+
+#include <pthread.h>
+#include <stdint.h>
+
+#ifdef __APPLE__
+    #include <mach/mach_time.h>
+#else
+    #include <time.h>
+#endif
+
+class Profiler {
+public:
+    // a completed zone - name must be a string literal (or otherwise outlive the profiler)
+    struct Event {
+        const char* name;
+        uint64_t    start;  // nanoseconds, monotonic clock
+        uint64_t    end;
+        uint32_t    frame;
+    };
+
+    // one per thread, only ever written by its owning thread
+    struct ThreadBuffer;
+
+    static const uint32_t s_bufferSize = 16384; // events per thread (power of 2)
+
+    static void     setEnabled( bool enabled );
+    static bool     isEnabled() { return s_bEnabled; }
+
+    // call once at the top of each frame so events can be grouped per frame
+    static void     beginFrame();
+
+    // write the buffered events of the last numFrames frames (0 = everything buffered)
+    static bool     saveChromeTrace( const string &path, uint32_t numFrames=0 );
+
+    // per-zone count / mean / percentiles in microseconds
+    static string   getSummary( uint32_t numFrames=0 );
+
+    // hot path - called by ProfilerScope
+    static ThreadBuffer*    getThreadBuffer();
+    static void             leaveZone( ThreadBuffer* buffer, const char* name, uint64_t start );
+
+    // monotonic nanoseconds - ofGetElapsedTimeMicros() is gettimeofday() on some platforms,
+    // which can step backwards and is too coarse for zones that take well under a microsecond
+    static uint64_t now() {
+#ifdef __APPLE__
+        return mach_absolute_time() * s_timebase.numer / s_timebase.denom;
+#else
+        timespec t;
+        clock_gettime( CLOCK_MONOTONIC, &t );
+        return (uint64_t)t.tv_sec * 1000000000ull + t.tv_nsec;
+#endif
+    }
+
+protected:
+
+    static void             createThreadKey();
+    static void             collectEvents( vector<Event> &events, vector<uint32_t> &threadIds, uint32_t numFrames );
+
+    static volatile bool            s_bEnabled;
+    static volatile uint32_t        s_frame;
+
+#ifdef __APPLE__
+    static mach_timebase_info_data_t s_timebase;
+#endif
+
+    static pthread_key_t            s_threadKey;
+    static pthread_once_t           s_threadKeyOnce;
+    static pthread_mutex_t          s_registryMutex; // only taken when a thread registers or on dump
+    static vector<ThreadBuffer*>    s_threadBuffers;
+};
+
+class ProfilerScope {
+public:
+    ProfilerScope( const char* name ) :
+    m_name(name),
+    m_buffer(NULL)
+    {
+        if ( Profiler::isEnabled() ) {
+            m_buffer = Profiler::getThreadBuffer();
+            m_start = Profiler::now();
+        }
+    }
+
+    ~ProfilerScope() {
+        if ( m_buffer != NULL ) {
+            Profiler::leaveZone( m_buffer, m_name, m_start );
+        }
+    }
+
+protected:
+    const char*             m_name;
+    Profiler::ThreadBuffer* m_buffer;
+    uint64_t                m_start;
+};
+
+#ifndef ESM_DISABLE_PROFILER
+    #define PROFILE_CONCAT_INNER(a, b)  a##b
+    #define PROFILE_CONCAT(a, b)        PROFILE_CONCAT_INNER(a, b)
+    #define PROFILE_SCOPE(name)         ProfilerScope PROFILE_CONCAT(profilerScope_, __LINE__)(name)
+#else
+    #define PROFILE_SCOPE(name)
+#endif
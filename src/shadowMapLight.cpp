@@ -6,6 +6,8 @@
 //  @jimmyacres
 
 #include "shadowMapLight.h"
+#include "profiler.h"
+#include "transformMath.h"
 
 ofVbo ShadowMapLight::s_quadVbo;
 
@@ -38,6 +40,7 @@ m_fbo2Id(0),
 m_depthTexture1Id(0),
 m_colorTexture1Id(0),
 m_colorTexture2Id(0),
+m_bViewDirty(true),
 m_bIsSetup(false)
 {}
 
@@ -46,6 +49,8 @@ void ShadowMapLight::setup( int shadowMapSize, float fov, float near, float far
     // make a projection matrix that we'll use to render a scene from our light's viewpoint
     m_projectionMatrix.makePerspectiveMatrix(fov, shadowMapSize/shadowMapSize, near, far);
     
+    m_bViewDirty = true; // projection changed - shadow matrix needs rebuilding
+
     m_shadowMapSize = shadowMapSize;
     m_texelSize = 1.0f/shadowMapSize;
 
@@ -175,6 +180,8 @@ void ShadowMapLight::setBlurLevel(float factor) {
 }
 
 void ShadowMapLight::beginShadowMap() {
+    PROFILE_SCOPE("ShadowMapLight::beginShadowMap");
+
     glBindFramebuffer(GL_FRAMEBUFFER, m_fbo1Id); // bind our FBO that has depth and color textures
 
     glClearColor( 1.0f, 1.0f, 1.0f, 1.0f );
@@ -191,7 +198,15 @@ void ShadowMapLight::beginShadowMap() {
     ofVec3f center = eye + getLookAtDir();
     ofVec3f up = ofVec3f(0.0f, 1.0f, 0.0f);
     
-    m_viewMatrix.makeLookAtViewMatrix(eye, center, up); // make our look at view matrix
+    // only rebuild our look at view matrix (and the light half of the shadow matrix) if the light has moved
+    if ( m_bViewDirty || eye != m_viewEye || center != m_viewCenter ) {
+        m_viewMatrix.makeLookAtViewMatrix(eye, center, up);
+        m_shadowProjectionMatrix = m_viewMatrix * m_projectionMatrix * s_biasMat;
+        
+        m_viewEye = eye;
+        m_viewCenter = center;
+        m_bViewDirty = false;
+    }
     
     // load the view and projection matrices + save our current ones so we can restore them when done
     glMatrixMode(GL_PROJECTION);
@@ -210,6 +225,8 @@ void ShadowMapLight::beginShadowMap() {
 }
 
 void ShadowMapLight::endShadowMap() {
+    PROFILE_SCOPE("ShadowMapLight::endShadowMap");
+
     m_linearDepthShader.end();
 
     // restore matrices
@@ -228,13 +245,18 @@ void ShadowMapLight::endShadowMap() {
 }
 
 ofMatrix4x4 ShadowMapLight::getShadowMatrix( ofCamera &cam ) {
+    PROFILE_SCOPE("ShadowMapLight::getShadowMatrix");
+
     // create a transform matrix that we can use in our shader to do the following while rendering our objects:
     // - convert our vertex position from camera/view space back to world space (need inverse of the camera's modelviewmatrix)
     // - convert this world space vertex to light clip space (view and projection matrix from out light)
     // - convert this light clip space value from -1.0 .. +1.0 to 0.0 .. 1.0 so that we can use it as a texture lookup for the shadowmap texture
+    //
+    // the camera modelview is affine so we can skip the general 4x4 inverse, and the light part is
+    // cached in beginShadowMap() so there's only one multiply left per call
     
-    ofMatrix4x4 inverseCameraMatrix = ofMatrix4x4::getInverseOf( cam.getModelViewMatrix() );
-    ofMatrix4x4 shadowTransMatrix = inverseCameraMatrix * m_viewMatrix * m_projectionMatrix * s_biasMat;
+    ofMatrix4x4 inverseCameraMatrix = TransformMath::getAffineInverse( cam.getModelViewMatrix() );
+    ofMatrix4x4 shadowTransMatrix = inverseCameraMatrix * m_shadowProjectionMatrix;
         
     return shadowTransMatrix;
 }
@@ -275,6 +297,8 @@ void ShadowMapLight::unbindShadowMapTexture() {
 }
 
 void ShadowMapLight::blurShadowMap() {
+    PROFILE_SCOPE("ShadowMapLight::blurShadowMap");
+
     // bind blur FBO
     glBindFramebuffer(GL_FRAMEBUFFER, m_fbo2Id);
     // save our old viewport so we can restore it
@@ -62,6 +62,11 @@ protected:
     
     ofMatrix4x4 m_viewMatrix;
     ofMatrix4x4 m_projectionMatrix;
+    ofMatrix4x4 m_shadowProjectionMatrix; // view * projection * bias, rebuilt when the light moves
+
+    ofVec3f     m_viewEye;      // look at inputs m_viewMatrix was last built from
+    ofVec3f     m_viewCenter;
+    bool        m_bViewDirty;
 
     GLuint      m_boundTexUnit;
         
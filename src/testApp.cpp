@@ -6,12 +6,24 @@
 //  @jimmyacres
 
 #include "testApp.h"
+#include "profiler.h"
+#include "transformMath.h"
 
 testApp::testApp() :
 m_angle(0),
 m_bDrawDepth(true),
 m_bDrawLight(true),
-m_bPaused(false)
+m_bPaused(false),
+m_bDepthPrepass(false),
+m_bSortObjects(true),
+m_queryFrame(0),
+m_bIssueQueries(false),
+m_bTimerQueries(false),
+m_prepassSamples(0),
+m_shadedSamples(0),
+m_bPrepassMeasured(false),
+m_prepassTime(0),
+m_shadedTime(0)
 {};
     
 
@@ -43,12 +55,34 @@ void testApp::setup() {
     
     m_shader.load( "shaders/mainScene.vert", "shaders/mainScene.frag" );
     
+    // depth only pass - same position path as the shadow map, no lighting or shadow lookups
+    m_depthPrepassShader.load( "shaders/linearDepthBuffer.vert", "shaders/depthOnly.frag" );
+    
+    // gpu timing needs timer queries - OS X 10.8's GL 2.1 context has the EXT version
+    m_bTimerQueries = GLEW_ARB_timer_query || GLEW_EXT_timer_query;
+    
+    glGenQueries( NUM_QUERY_SETS * NUM_PASSES, &m_sampleQueries[0][0] );
+    glGenQueries( NUM_QUERY_SETS * NUM_PASSES, &m_timeQueries[0][0] );
+    for ( int i=0; i<NUM_QUERY_SETS; i++ ) {
+        for ( int j=0; j<NUM_PASSES; j++ ) {
+            m_bQueryIssued[i][j] = false;
+        }
+        m_bQuerySetPending[i] = false;
+    }
+    
     setupLights();
     createRandomObjects();
+
+    // ESM_PROFILE=1 starts with the profiler on, a summary is printed on exit
+    if ( getenv( "ESM_PROFILE" ) != NULL ) {
+        Profiler::setEnabled( true );
+    }
 }
 
 //--------------------------------------------------------------
 void testApp::update() { 
+    Profiler::beginFrame();
+
     ofSetWindowTitle( ofToString( ofGetFrameRate() ) );
 }
 
@@ -65,10 +99,53 @@ void testApp::createRandomObjects() {
         
         m_boxes.push_back( Box( ofVec3f(x, y, z), size ) );
     }
+    
+    m_boxCenters.resize( m_boxes.size() );
+    m_drawOrder.resize( m_boxes.size() );
+    
+    for ( size_t i=0; i<m_boxes.size(); i++ ) {
+        m_boxCenters.set( i, m_boxes[i].pos );
+        m_drawOrder[i] = i;
+    }
 }
 
-void testApp::drawObjects() {
+namespace {
+    // orders box indices by view space depth
+    struct DepthCompare {
+        const vector<float> &depths;
+        DepthCompare( const vector<float> &depths ) : depths(depths) {}
+        bool operator()( size_t a, size_t b ) const { return depths[a] < depths[b]; }
+    };
     
+    // 64 bit query results come from whichever timer query extension we have
+    void getQueryResult64( GLuint query, GLuint64 *result ) {
+        if ( GLEW_ARB_timer_query ) {
+            glGetQueryObjectui64v( query, GL_QUERY_RESULT, result );
+        } else {
+            glGetQueryObjectui64vEXT( query, GL_QUERY_RESULT, (GLuint64EXT*)result );
+        }
+    }
+}
+
+void testApp::sortObjects() {
+    PROFILE_SCOPE("testApp::sortObjects");
+    
+    // front to back from the camera, so the depth test rejects hidden fragments before they're shaded.
+    // the camera modelview is affine so the batched kernel can do the whole set at once
+    TransformMath::transformPoints( m_boxCenters, m_cam.getModelViewMatrix(), m_boxViewPositions );
+    
+    m_boxDepths.resize( m_boxes.size() );
+    for ( size_t i=0; i<m_boxes.size(); i++ ) {
+        m_boxDepths[i] = -m_boxViewPositions.z[i]; // camera looks down -z
+    }
+    
+    // last frame's order is nearly sorted already
+    sort( m_drawOrder.begin(), m_drawOrder.end(), DepthCompare( m_boxDepths ) );
+}
+
+void testApp::drawObjects() {
+    PROFILE_SCOPE("testApp::drawObjects");
+
     glEnable(GL_CULL_FACE);
     glCullFace(GL_BACK);
     
@@ -78,13 +155,120 @@ void testApp::drawObjects() {
     ofBox(0,0,0,1.0f);    
     ofPopMatrix();
 
-    // draw our boxes
-    vector<Box>::iterator it;
-    for ( it=m_boxes.begin() ; it < m_boxes.end(); it++ ) {
-       ofBox( it->pos, it->size );
+    // draw our boxes - in m_drawOrder, which is front to back from the camera when sorting is on
+    vector<size_t>::iterator it;
+    for ( it=m_drawOrder.begin() ; it < m_drawOrder.end(); it++ ) {
+       ofBox( m_boxes[*it].pos, m_boxes[*it].size );
+    }
+}
+
+void testApp::beginOverdrawQueries( int pass ) {
+    if ( !m_bIssueQueries ) {
+        return;
+    }
+    
+    // different targets, so both can be active at once
+    glBeginQuery( GL_SAMPLES_PASSED, m_sampleQueries[m_queryFrame][pass] );
+    if ( m_bTimerQueries ) {
+        glBeginQuery( GL_TIME_ELAPSED_EXT, m_timeQueries[m_queryFrame][pass] );
+    }
+    
+    m_bQueryIssued[m_queryFrame][pass] = true;
+}
+
+void testApp::endOverdrawQueries() {
+    if ( !m_bIssueQueries ) {
+        return;
+    }
+    
+    glEndQuery( GL_SAMPLES_PASSED );
+    if ( m_bTimerQueries ) {
+        glEndQuery( GL_TIME_ELAPSED_EXT );
     }
 }
 
+bool testApp::readOverdrawQuerySet( int set ) {
+    // the main pass queries are the last ones issued in a set, so once they're done the rest are too
+    GLuint available = 0;
+    GLuint lastQuery = m_bTimerQueries ? m_timeQueries[set][PASS_MAIN] : m_sampleQueries[set][PASS_MAIN];
+    glGetQueryObjectuiv( lastQuery, GL_QUERY_RESULT_AVAILABLE, &available );
+    if ( !available ) {
+        return false;
+    }
+    
+    glGetQueryObjectuiv( m_sampleQueries[set][PASS_MAIN], GL_QUERY_RESULT, &m_shadedSamples );
+    
+    m_bPrepassMeasured = m_bQueryIssued[set][PASS_PREPASS];
+    if ( m_bPrepassMeasured ) {
+        glGetQueryObjectuiv( m_sampleQueries[set][PASS_PREPASS], GL_QUERY_RESULT, &m_prepassSamples );
+    }
+    
+    if ( m_bTimerQueries ) {
+        getQueryResult64( m_timeQueries[set][PASS_MAIN], &m_shadedTime );
+        if ( m_bPrepassMeasured ) {
+            getQueryResult64( m_timeQueries[set][PASS_PREPASS], &m_prepassTime );
+        }
+    }
+    
+    return true;
+}
+
+void testApp::readOverdrawQueries() {
+    // read every finished set, oldest first, so we end up showing the newest results. skip anything
+    // the gpu hasn't got to yet rather than wait - sets finish in order, so stop at the first pending one
+    for ( int i=0; i<NUM_QUERY_SETS; i++ ) {
+        int set = (m_queryFrame + i) % NUM_QUERY_SETS;
+        
+        if ( !m_bQuerySetPending[set] ) {
+            continue;
+        }
+        
+        if ( !readOverdrawQuerySet( set ) ) {
+            break;
+        }
+        
+        m_bQuerySetPending[set] = false;
+    }
+    
+    // only reuse this frame's set once its results are in, and start it clean so a pass
+    // that isn't drawn this frame (eg. the prepass after pressing D) can't leave a stale flag behind
+    m_bIssueQueries = !m_bQuerySetPending[m_queryFrame];
+    
+    if ( m_bIssueQueries ) {
+        for ( int j=0; j<NUM_PASSES; j++ ) {
+            m_bQueryIssued[m_queryFrame][j] = false;
+        }
+    }
+}
+
+string testApp::getOverdrawInfo() {
+    string info = "Depth prepass: " + string( m_bDepthPrepass ? "on" : "off" ) + ", front to back sort: " + string( m_bSortObjects ? "on" : "off" );
+    info += "\nShaded fragments: " + ofToString( m_shadedSamples );
+    
+    if ( m_bPrepassMeasured && m_shadedSamples > 0 && m_prepassSamples > 0 ) {
+        // the prepass depth tests the same geometry in the same order as the main pass would without it,
+        // so its sample count is what we'd have shaded - the main pass only shades visible fragments
+        float overdraw = (float)m_prepassSamples / m_shadedSamples;
+        float saved = 100.0f * (1.0f - (float)m_shadedSamples / m_prepassSamples);
+        info += ", without prepass: " + ofToString( m_prepassSamples ) + ", overdraw ratio: " + ofToString( overdraw, 2 ) + ", shading saved: " + ofToString( saved, 1 ) + "%";
+    } else {
+        info += " (enable the depth prepass to measure overdraw)";
+    }
+    
+    // gpu time of the draw calls in each pass - the frame rate is locked to vsync so it won't show the difference.
+    // compare prepass + shaded pass with D on against the shaded pass with D off
+    if ( m_bTimerQueries ) {
+        info += "\nGPU shaded pass: " + ofToString( m_shadedTime / 1000000.0, 3 ) + " ms";
+        if ( m_bPrepassMeasured ) {
+            info += ", depth prepass: " + ofToString( m_prepassTime / 1000000.0, 3 ) + " ms, total: " + ofToString( (m_prepassTime + m_shadedTime) / 1000000.0, 3 ) + " ms";
+        }
+    } else {
+        info += "\nGPU timing unavailable (no timer query support)";
+    }
+    
+    return info;
+}
+
 void testApp::setupLights() {
     // ofxShadowMapLight extends ofLight - you can use it just like a regular light
     // it's set up as a spotlight, all the shadow work + lighting must be handled in a shader
@@ -106,7 +290,8 @@ void testApp::setupLights() {
 
 //--------------------------------------------------------------
 void testApp::draw() {
-    
+    PROFILE_SCOPE("testApp::draw");
+
     glEnable( GL_DEPTH_TEST );
     
     ofDisableAlphaBlending();
@@ -119,6 +304,12 @@ void testApp::draw() {
     m_shadowLight.orbit( m_angle, -30.0, 50.0f, ofVec3f(0.0,0.0,0.0) );
 
     m_shadowLight.enable();
+    
+    readOverdrawQueries();
+    
+    if ( m_bSortObjects ) {
+        sortObjects();
+    }
    
     // render linear depth buffer from light view
     m_shadowLight.beginShadowMap();
@@ -127,6 +318,30 @@ void testApp::draw() {
     
     // render final scene
     glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+    
+    if ( m_bDepthPrepass ) {
+        PROFILE_SCOPE("testApp::depthPrepass"); // cpu submission only - gpu cost comes from the timer queries
+        
+        // lay down depth only so the main pass only shades the nearest fragment of each pixel.
+        // both passes use ftransform() so the depth values match exactly for GL_EQUAL
+        glColorMask( GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE );
+        
+        m_depthPrepassShader.begin();
+        m_cam.begin();
+        
+        beginOverdrawQueries( PASS_PREPASS );
+            drawObjects();
+        endOverdrawQueries();
+        
+        m_cam.end();
+        m_depthPrepassShader.end();
+        
+        glColorMask( GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE );
+        
+        // depth is already final - only shade fragments that match it
+        glDepthFunc( GL_EQUAL );
+        glDepthMask( GL_FALSE );
+    }
   
     m_shader.begin();
 
@@ -138,9 +353,17 @@ void testApp::draw() {
     m_cam.begin();
     
     m_shadowLight.enable();
-        drawObjects();
+        beginOverdrawQueries( PASS_MAIN );
+            drawObjects();
+        endOverdrawQueries();
     m_shadowLight.disable();
     
+    if ( m_bDepthPrepass ) {
+        // the light isn't in the prepass - back to regular depth testing for it
+        glDepthFunc( GL_LESS );
+        glDepthMask( GL_TRUE );
+    }
+    
     if ( m_bDrawLight ) {
         glDisable(GL_CULL_FACE);
         m_shadowLight.draw();
@@ -159,12 +382,26 @@ void testApp::draw() {
         m_shadowLight.debugShadowMap();
     }
     
+    if ( m_bIssueQueries ) {
+        m_bQuerySetPending[m_queryFrame] = true;
+        m_queryFrame = (m_queryFrame + 1) % NUM_QUERY_SETS;
+    }
+    
     // draw info string
     ofDisableLighting();
     glDisable(GL_CULL_FACE);
     glDisable(GL_DEPTH_TEST);
     ofSetColor(255, 0, 0, 255);
-    ofDrawBitmapString("Press SPACE to toggle rendering the shadow map texture (linear depth map)\nPress L to toggle drawing the light\nPress P to toggle pause", ofPoint(15, 20));
+    ofDrawBitmapString("Press SPACE to toggle rendering the shadow map texture (linear depth map)\nPress L to toggle drawing the light\nPress P to toggle pause\nPress F to toggle the CPU profiler, T to save a trace, R to print a profile summary\nPress B to validate and benchmark the transform kernels\nPress D to toggle the depth prepass, S to toggle front to back sorting\n" + getOverdrawInfo(), ofPoint(15, 20));
+}
+
+//--------------------------------------------------------------
+void testApp::exit() {
+    // print a summary on exit if profiling was on - handy for headless/scripted runs
+    if ( Profiler::isEnabled() ) {
+        printf( "%s", Profiler::getSummary().c_str() );
+        printf( "%s\n", getOverdrawInfo().c_str() );
+    }
 }
 
 //--------------------------------------------------------------
@@ -180,6 +417,30 @@ void testApp::keyReleased(int key){
         m_bDrawLight = !m_bDrawLight;
     } else if ( key == 'p' ) {
         m_bPaused = !m_bPaused;
+    } else if ( key == 'f' ) {
+        Profiler::setEnabled( !Profiler::isEnabled() );
+        printf("Profiler %s\n", Profiler::isEnabled() ? "enabled" : "disabled" );
+    } else if ( key == 't' ) {
+        // last 120 frames - load in chrome://tracing or ui.perfetto.dev
+        Profiler::saveChromeTrace( ofToDataPath( "profile_" + ofGetTimestampString() + ".json" ), 120 );
+    } else if ( key == 'r' ) {
+        printf( "%s", Profiler::getSummary().c_str() );
+        printf( "%s\n", getOverdrawInfo().c_str() );
+    } else if ( key == 'd' ) {
+        m_bDepthPrepass = !m_bDepthPrepass;
+    } else if ( key == 's' ) {
+        m_bSortObjects = !m_bSortObjects;
+        
+        if ( !m_bSortObjects ) {
+            // back to creation order
+            for ( size_t i=0; i<m_drawOrder.size(); i++ ) {
+                m_drawOrder[i] = i;
+            }
+        }
+    } else if ( key == 'b' ) {
+        // check the batched transform kernels against ofMatrix4x4 and time them
+        TransformMath::runSelfTest();
+        TransformMath::runBenchmarks();
     }
 }
 
@@ -9,6 +9,7 @@
 
 #include "ofMain.h"
 #include "shadowMapLight.h"
+#include "transformMath.h"
 
 class testApp : public ofBaseApp {
     
@@ -28,6 +29,7 @@ class testApp : public ofBaseApp {
         void setup();
 		void update();
 		void draw();
+		void exit();
 		
 		void keyPressed(int key);
 		void keyReleased(int key);
@@ -42,16 +44,52 @@ class testApp : public ofBaseApp {
         void setupLights();
         void createRandomObjects();
         void drawObjects();
+        void sortObjects();
+    
+        void beginOverdrawQueries( int pass );
+        void endOverdrawQueries();
+        void readOverdrawQueries();
+        bool readOverdrawQuerySet( int set );
+        string getOverdrawInfo();
     
         ofEasyCam m_cam;
         ShadowMapLight m_shadowLight;
     
         ofShader m_shader;
+        ofShader m_depthPrepassShader;
     
         float   m_angle;    
         bool    m_bDrawDepth;
         bool    m_bDrawLight;
         bool    m_bPaused;
+        bool    m_bDepthPrepass;
+        bool    m_bSortObjects;
 
         vector<Box> m_boxes;
+    
+        // box centers kept as SoA so they can be batch transformed into view space for sorting
+        TransformMath::PointArray m_boxCenters;
+        TransformMath::PointArray m_boxViewPositions;
+        vector<float>   m_boxDepths;
+        vector<size_t>  m_drawOrder;
+    
+        // GL_SAMPLES_PASSED + GL_TIME_ELAPSED queries for the depth prepass and the shaded main pass.
+        // a ring of query sets so we read results frames later instead of stalling - the driver can
+        // queue a few frames with vsync on. a frame skips its queries if its set is still pending
+        enum { PASS_PREPASS, PASS_MAIN, NUM_PASSES };
+        enum { NUM_QUERY_SETS = 4 };
+    
+        GLuint  m_sampleQueries[NUM_QUERY_SETS][NUM_PASSES];
+        GLuint  m_timeQueries[NUM_QUERY_SETS][NUM_PASSES];
+        bool    m_bQueryIssued[NUM_QUERY_SETS][NUM_PASSES];
+        bool    m_bQuerySetPending[NUM_QUERY_SETS];
+        int     m_queryFrame;       // set used by the current frame
+        bool    m_bIssueQueries;    // false if this frame's set hasn't been read back yet
+        bool    m_bTimerQueries;    // GL_ARB_timer_query / GL_EXT_timer_query available
+    
+        GLuint  m_prepassSamples;   // fragments passing the depth test in the prepass = what the main pass would shade without it
+        GLuint  m_shadedSamples;    // fragments shaded by mainScene.frag
+        bool    m_bPrepassMeasured; // m_prepassSamples/m_prepassTime are from the same frame as the main pass
+        GLuint64 m_prepassTime;     // gpu nanoseconds
+        GLuint64 m_shadedTime;
 };
@@ -0,0 +1,530 @@
+//  TransformMath.cpp
+//
+//  Affine fast paths and batched SSE/AVX transform kernels - see TransformMath.h
+
+#include "transformMath.h"
+
+#include <float.h>
+
+#if defined(__AVX__)
+    #include <immintrin.h>
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+    #include <xmmintrin.h>
+    #define TRANSFORM_MATH_SSE
+#endif
+
+namespace {
+
+    // the widest instruction set we're compiled for - the xcode project enables SSE3, build with -mavx for 8 wide
+#if defined(__AVX__)
+    typedef __m256 Simd;
+    const size_t    s_simdWidth = 8;
+    const char*     s_simdName = "AVX";
+
+    inline Simd simdLoad( const float* p )      { return _mm256_loadu_ps( p ); }
+    inline void simdStore( float* p, Simd v )   { _mm256_storeu_ps( p, v ); }
+    inline Simd simdSet( float f )              { return _mm256_set1_ps( f ); }
+    inline Simd simdAdd( Simd a, Simd b )       { return _mm256_add_ps( a, b ); }
+    inline Simd simdMul( Simd a, Simd b )       { return _mm256_mul_ps( a, b ); }
+#elif defined(TRANSFORM_MATH_SSE)
+    typedef __m128 Simd;
+    const size_t    s_simdWidth = 4;
+    const char*     s_simdName = "SSE";
+
+    inline Simd simdLoad( const float* p )      { return _mm_loadu_ps( p ); }
+    inline void simdStore( float* p, Simd v )   { _mm_storeu_ps( p, v ); }
+    inline Simd simdSet( float f )              { return _mm_set1_ps( f ); }
+    inline Simd simdAdd( Simd a, Simd b )       { return _mm_add_ps( a, b ); }
+    inline Simd simdMul( Simd a, Simd b )       { return _mm_mul_ps( a, b ); }
+#else
+    typedef float Simd;
+    const size_t    s_simdWidth = 1;
+    const char*     s_simdName = "scalar";
+
+    inline Simd simdLoad( const float* p )      { return *p; }
+    inline void simdStore( float* p, Simd v )   { *p = v; }
+    inline Simd simdSet( float f )              { return f; }
+    inline Simd simdAdd( Simd a, Simd b )       { return a + b; }
+    inline Simd simdMul( Simd a, Simd b )       { return a * b; }
+#endif
+
+    // a*b + c*d + e*f
+    inline Simd simdDot3( Simd a, Simd b, Simd c, Simd d, Simd e, Simd f ) {
+        return simdAdd( simdAdd( simdMul( a, b ), simdMul( c, d ) ), simdMul( e, f ) );
+    }
+
+    // matrix elements broadcast across all lanes
+    struct BroadcastMatrix {
+        Simd m[16];
+
+        BroadcastMatrix( const ofMatrix4x4 &mat, bool bAbs=false ) {
+            const float* p = mat.getPtr();
+            for ( int i=0; i<16; i++ ) {
+                m[i] = simdSet( bAbs ? fabsf( p[i] ) : p[i] );
+            }
+        }
+    };
+
+    // one block of s_simdWidth instances at offset i. every block loads all of its inputs before storing,
+    // so in and out may be the same arrays
+    inline void multiplyMatricesBlock( const float* const in[16], float* const out[16], size_t i, const BroadcastMatrix &b ) {
+        for ( int r=0; r<4; r++ ) {
+            Simd a0 = simdLoad( in[r*4 + 0] + i );
+            Simd a1 = simdLoad( in[r*4 + 1] + i );
+            Simd a2 = simdLoad( in[r*4 + 2] + i );
+            Simd a3 = simdLoad( in[r*4 + 3] + i );
+
+            for ( int c=0; c<4; c++ ) {
+                Simd v = simdAdd( simdDot3( a0, b.m[c], a1, b.m[4 + c], a2, b.m[8 + c] ), simdMul( a3, b.m[12 + c] ) );
+                simdStore( out[r*4 + c] + i, v );
+            }
+        }
+    }
+
+    inline void transformPointsBlock( const float* const in[3], float* const out[3], size_t i, const BroadcastMatrix &b ) {
+        Simd x = simdLoad( in[0] + i );
+        Simd y = simdLoad( in[1] + i );
+        Simd z = simdLoad( in[2] + i );
+
+        for ( int c=0; c<3; c++ ) {
+            simdStore( out[c] + i, simdAdd( simdDot3( x, b.m[c], y, b.m[4 + c], z, b.m[8 + c] ), b.m[12 + c] ) );
+        }
+    }
+
+    // extents only need the 3x3 part with absolute values
+    inline void transformExtentsBlock( const float* const in[3], float* const out[3], size_t i, const BroadcastMatrix &absB ) {
+        Simd x = simdLoad( in[0] + i );
+        Simd y = simdLoad( in[1] + i );
+        Simd z = simdLoad( in[2] + i );
+
+        for ( int c=0; c<3; c++ ) {
+            simdStore( out[c] + i, simdDot3( x, absB.m[c], y, absB.m[4 + c], z, absB.m[8 + c] ) );
+        }
+    }
+
+    // runs block over n instances of numArrays component arrays - the leftover instances that don't fill a
+    // whole block are copied through a padded scratch block so the kernels never need a scalar version
+    template<int numArrays, class Block>
+    void runBatched( const float* const in[numArrays], float* const out[numArrays], size_t n, Block block ) {
+        size_t i = 0;
+        for ( ; i + s_simdWidth <= n; i += s_simdWidth ) {
+            block( in, out, i );
+        }
+
+        if ( i == n ) {
+            return;
+        }
+
+        float scratchIn[numArrays][s_simdWidth];
+        float scratchOut[numArrays][s_simdWidth];
+        const float* tailIn[numArrays];
+        float* tailOut[numArrays];
+
+        for ( int a=0; a<numArrays; a++ ) {
+            for ( size_t j=0; j<s_simdWidth; j++ ) {
+                scratchIn[a][j] = i + j < n ? in[a][i + j] : 0.0f;
+            }
+            tailIn[a] = scratchIn[a];
+            tailOut[a] = scratchOut[a];
+        }
+
+        block( tailIn, tailOut, 0 );
+
+        for ( int a=0; a<numArrays; a++ ) {
+            for ( size_t j=0; i + j < n; j++ ) {
+                out[a][i + j] = scratchOut[a][j];
+            }
+        }
+    }
+
+    // adapters so runBatched can call the blocks with the broadcast matrix bound
+    struct MultiplyMatrices {
+        const BroadcastMatrix &b;
+        MultiplyMatrices( const BroadcastMatrix &b ) : b(b) {}
+        void operator()( const float* const in[16], float* const out[16], size_t i ) const { multiplyMatricesBlock( in, out, i, b ); }
+    };
+
+    struct TransformPoints {
+        const BroadcastMatrix &b;
+        TransformPoints( const BroadcastMatrix &b ) : b(b) {}
+        void operator()( const float* const in[3], float* const out[3], size_t i ) const { transformPointsBlock( in, out, i, b ); }
+    };
+
+    struct TransformExtents {
+        const BroadcastMatrix &b;
+        TransformExtents( const BroadcastMatrix &b ) : b(b) {}
+        void operator()( const float* const in[3], float* const out[3], size_t i ) const { transformExtentsBlock( in, out, i, b ); }
+    };
+
+    void transformPointArray( const TransformMath::PointArray &in, const BroadcastMatrix &b, TransformMath::PointArray &out ) {
+        const float* inPtrs[3] = { &in.x[0], &in.y[0], &in.z[0] };
+        float* outPtrs[3] = { &out.x[0], &out.y[0], &out.z[0] };
+        runBatched<3>( inPtrs, outPtrs, in.size(), TransformPoints( b ) );
+    }
+
+    bool isAffine( const float* p ) {
+        return p[3] == 0.0f && p[7] == 0.0f && p[11] == 0.0f && p[15] == 1.0f;
+    }
+}
+
+namespace TransformMath {
+
+ofMatrix4x4 getAffineInverse( const ofMatrix4x4 &m ) {
+    const float* p = m.getPtr();
+
+    if ( !isAffine( p ) ) {
+        return ofMatrix4x4::getInverseOf( m );
+    }
+
+    // inverse of the upper 3x3 from its cofactors
+    float c00 = p[5]*p[10] - p[6]*p[9];
+    float c01 = p[6]*p[8]  - p[4]*p[10];
+    float c02 = p[4]*p[9]  - p[5]*p[8];
+
+    float det = p[0]*c00 + p[1]*c01 + p[2]*c02;
+
+    if ( fabsf( det ) < 1e-12f ) {
+        return ofMatrix4x4::getInverseOf( m ); // singular - let ofMatrix4x4 deal with it
+    }
+
+    float invDet = 1.0f / det;
+
+    float i00 = c00 * invDet;
+    float i01 = (p[2]*p[9]  - p[1]*p[10]) * invDet;
+    float i02 = (p[1]*p[6]  - p[2]*p[5])  * invDet;
+    float i10 = c01 * invDet;
+    float i11 = (p[0]*p[10] - p[2]*p[8])  * invDet;
+    float i12 = (p[2]*p[4]  - p[0]*p[6])  * invDet;
+    float i20 = c02 * invDet;
+    float i21 = (p[1]*p[8]  - p[0]*p[9])  * invDet;
+    float i22 = (p[0]*p[5]  - p[1]*p[4])  * invDet;
+
+    // translation row: -t * inverse(3x3)
+    float tx = p[12], ty = p[13], tz = p[14];
+
+    return ofMatrix4x4( i00, i01, i02, 0.0f,
+                        i10, i11, i12, 0.0f,
+                        i20, i21, i22, 0.0f,
+                        -(tx*i00 + ty*i10 + tz*i20), -(tx*i01 + ty*i11 + tz*i21), -(tx*i02 + ty*i12 + tz*i22), 1.0f );
+}
+
+void MatrixArray::resize( size_t n ) {
+    for ( int i=0; i<16; i++ ) {
+        m[i].resize( n );
+    }
+}
+
+void MatrixArray::set( size_t i, const ofMatrix4x4 &mat ) {
+    const float* p = mat.getPtr();
+    for ( int j=0; j<16; j++ ) {
+        m[j][i] = p[j];
+    }
+}
+
+ofMatrix4x4 MatrixArray::get( size_t i ) const {
+    float p[16];
+    for ( int j=0; j<16; j++ ) {
+        p[j] = m[j][i];
+    }
+    return ofMatrix4x4( p );
+}
+
+void PointArray::resize( size_t n ) {
+    x.resize( n );
+    y.resize( n );
+    z.resize( n );
+}
+
+void PointArray::set( size_t i, const ofVec3f &p ) {
+    x[i] = p.x;
+    y[i] = p.y;
+    z[i] = p.z;
+}
+
+ofVec3f PointArray::get( size_t i ) const {
+    return ofVec3f( x[i], y[i], z[i] );
+}
+
+void BoundsArray::resize( size_t n ) {
+    center.resize( n );
+    extent.resize( n );
+}
+
+void multiplyMatrices( const MatrixArray &in, const ofMatrix4x4 &mat, MatrixArray &out ) {
+    size_t n = in.size();
+    out.resize( n );
+
+    if ( n == 0 ) {
+        return;
+    }
+
+    BroadcastMatrix b( mat );
+
+    const float* inPtrs[16];
+    float* outPtrs[16];
+    for ( int j=0; j<16; j++ ) {
+        inPtrs[j] = &in.m[j][0];
+        outPtrs[j] = &out.m[j][0];
+    }
+
+    runBatched<16>( inPtrs, outPtrs, n, MultiplyMatrices( b ) );
+}
+
+void transformPoints( const PointArray &in, const ofMatrix4x4 &mat, PointArray &out ) {
+    out.resize( in.size() );
+
+    if ( in.size() == 0 ) {
+        return;
+    }
+
+    transformPointArray( in, BroadcastMatrix( mat ), out );
+}
+
+void transformBounds( const BoundsArray &in, const ofMatrix4x4 &mat, BoundsArray &out ) {
+    out.resize( in.size() );
+
+    if ( in.size() == 0 ) {
+        return;
+    }
+
+    transformPointArray( in.center, BroadcastMatrix( mat ), out.center );
+
+    BroadcastMatrix absB( mat, true );
+    const float* inPtrs[3] = { &in.extent.x[0], &in.extent.y[0], &in.extent.z[0] };
+    float* outPtrs[3] = { &out.extent.x[0], &out.extent.y[0], &out.extent.z[0] };
+    runBatched<3>( inPtrs, outPtrs, in.size(), TransformExtents( absB ) );
+}
+
+//--------------------------------------------------------------
+// validation + benchmarks
+
+namespace {
+    // rotation, non uniform scale and translation - the kind of matrices we get for objects and cameras
+    ofMatrix4x4 randomAffineMatrix() {
+        ofMatrix4x4 m = ofMatrix4x4::newScaleMatrix( ofRandom( 0.1f, 4.0f ), ofRandom( 0.1f, 4.0f ), ofRandom( 0.1f, 4.0f ) );
+        m = m * ofMatrix4x4::newRotationMatrix( ofRandom( -180.0f, 180.0f ), ofVec3f( ofRandom( -1.0f, 1.0f ), ofRandom( -1.0f, 1.0f ), 1.0f ).normalized() );
+        m = m * ofMatrix4x4::newTranslationMatrix( ofRandom( -50.0f, 50.0f ), ofRandom( -50.0f, 50.0f ), ofRandom( -50.0f, 50.0f ) );
+        return m;
+    }
+
+    ofVec3f randomPoint( float range ) {
+        return ofVec3f( ofRandom( -range, range ), ofRandom( -range, range ), ofRandom( -range, range ) );
+    }
+
+    // largest element difference relative to the magnitude of the expected matrix
+    float matrixError( const ofMatrix4x4 &a, const ofMatrix4x4 &b ) {
+        const float* pa = a.getPtr();
+        const float* pb = b.getPtr();
+        float maxDiff = 0.0f;
+        float maxVal = 1.0f;
+        for ( int i=0; i<16; i++ ) {
+            maxDiff = MAX( maxDiff, fabsf( pa[i] - pb[i] ) );
+            maxVal = MAX( maxVal, fabsf( pb[i] ) );
+        }
+        return maxDiff / maxVal;
+    }
+
+    float pointError( const ofVec3f &a, const ofVec3f &b ) {
+        float maxVal = MAX( 1.0f, MAX( fabsf( b.x ), MAX( fabsf( b.y ), fabsf( b.z ) ) ) );
+        return MAX( fabsf( a.x - b.x ), MAX( fabsf( a.y - b.y ), fabsf( a.z - b.z ) ) ) / maxVal;
+    }
+
+    bool checkError( const char* name, float error ) {
+        const float tolerance = 1e-4f;
+        bool bPassed = error < tolerance;
+        printf("TransformMath: %-20s max relative error %g %s\n", name, error, bPassed ? "ok" : "FAILED" );
+        return bPassed;
+    }
+
+    // ns per instance
+    double nsPer( uint64_t micros, size_t count ) {
+        return micros * 1000.0 / count;
+    }
+}
+
+bool runSelfTest() {
+    // odd count so the padded tail block gets exercised as well
+    const size_t n = 1003;
+    bool bPassed = true;
+
+    // affine inverse
+    float inverseError = 0.0f;
+    for ( size_t i=0; i<n; i++ ) {
+        ofMatrix4x4 m = randomAffineMatrix();
+        inverseError = MAX( inverseError, matrixError( getAffineInverse( m ), ofMatrix4x4::getInverseOf( m ) ) );
+    }
+    bPassed &= checkError( "getAffineInverse", inverseError );
+
+    // matrix batches - use a projection as the shared matrix so the full 4x4 product is checked
+    ofMatrix4x4 projection;
+    projection.makePerspectiveMatrix( 45.0f, 16.0f/9.0f, 0.1f, 100.0f );
+    ofMatrix4x4 shared = randomAffineMatrix() * projection;
+
+    MatrixArray matrices;
+    matrices.resize( n );
+    for ( size_t i=0; i<n; i++ ) {
+        matrices.set( i, randomAffineMatrix() );
+    }
+
+    MatrixArray multiplied;
+    multiplyMatrices( matrices, shared, multiplied );
+
+    float multiplyError = 0.0f;
+    for ( size_t i=0; i<n; i++ ) {
+        multiplyError = MAX( multiplyError, matrixError( multiplied.get( i ), matrices.get( i ) * shared ) );
+    }
+    bPassed &= checkError( "multiplyMatrices", multiplyError );
+
+    // points
+    ofMatrix4x4 affine = randomAffineMatrix();
+
+    PointArray points;
+    points.resize( n );
+    for ( size_t i=0; i<n; i++ ) {
+        points.set( i, randomPoint( 20.0f ) );
+    }
+
+    PointArray transformed;
+    transformPoints( points, affine, transformed );
+
+    float pointsError = 0.0f;
+    for ( size_t i=0; i<n; i++ ) {
+        pointsError = MAX( pointsError, pointError( transformed.get( i ), affine.preMult( points.get( i ) ) ) );
+    }
+    bPassed &= checkError( "transformPoints", pointsError );
+
+    // bounds - compare against the min/max of the 8 transformed corners
+    BoundsArray bounds;
+    bounds.resize( n );
+    for ( size_t i=0; i<n; i++ ) {
+        bounds.center.set( i, randomPoint( 20.0f ) );
+        bounds.extent.set( i, ofVec3f( ofRandom( 0.1f, 5.0f ), ofRandom( 0.1f, 5.0f ), ofRandom( 0.1f, 5.0f ) ) );
+    }
+
+    BoundsArray transformedBounds;
+    transformBounds( bounds, affine, transformedBounds );
+
+    float boundsError = 0.0f;
+    for ( size_t i=0; i<n; i++ ) {
+        ofVec3f c = bounds.center.get( i );
+        ofVec3f e = bounds.extent.get( i );
+
+        ofVec3f minCorner( FLT_MAX, FLT_MAX, FLT_MAX );
+        ofVec3f maxCorner( -FLT_MAX, -FLT_MAX, -FLT_MAX );
+        for ( int corner=0; corner<8; corner++ ) {
+            ofVec3f p = c + ofVec3f( corner & 1 ? e.x : -e.x, corner & 2 ? e.y : -e.y, corner & 4 ? e.z : -e.z );
+            p = affine.preMult( p );
+            minCorner.set( MIN( minCorner.x, p.x ), MIN( minCorner.y, p.y ), MIN( minCorner.z, p.z ) );
+            maxCorner.set( MAX( maxCorner.x, p.x ), MAX( maxCorner.y, p.y ), MAX( maxCorner.z, p.z ) );
+        }
+
+        ofVec3f tc = transformedBounds.center.get( i );
+        ofVec3f te = transformedBounds.extent.get( i );
+        boundsError = MAX( boundsError, pointError( tc - te, minCorner ) );
+        boundsError = MAX( boundsError, pointError( tc + te, maxCorner ) );
+    }
+    bPassed &= checkError( "transformBounds", boundsError );
+
+    return bPassed;
+}
+
+void runBenchmarks() {
+    printf("TransformMath: benchmarks using %s (%lu wide), ns per instance\n", s_simdName, (unsigned long)s_simdWidth );
+    printf("%-20s %8s %12s %12s %8s\n", "kernel", "count", "ofMatrix4x4", "batched", "speedup" );
+
+    const size_t counts[] = { 64, 1024, 16384, 262144 };
+    const size_t instancesPerRun = 4000000; // repeat small batches so every run does a similar amount of work
+
+    ofMatrix4x4 shared = randomAffineMatrix();
+    float checksum = 0.0f; // keeps the compiler from throwing away the reference loops
+
+    for ( size_t c=0; c<sizeof(counts)/sizeof(counts[0]); c++ ) {
+        size_t n = counts[c];
+        size_t reps = MAX( (size_t)1, instancesPerRun / n );
+
+        vector<ofMatrix4x4> matrices( n );
+        vector<ofMatrix4x4> multiplied( n );
+        MatrixArray matrixArray;
+        MatrixArray multipliedArray;
+        matrixArray.resize( n );
+
+        vector<ofVec3f> points( n );
+        vector<ofVec3f> transformed( n );
+        PointArray pointArray;
+        PointArray transformedArray;
+        pointArray.resize( n );
+
+        for ( size_t i=0; i<n; i++ ) {
+            matrices[i] = randomAffineMatrix();
+            matrixArray.set( i, matrices[i] );
+            points[i] = randomPoint( 20.0f );
+            pointArray.set( i, points[i] );
+        }
+
+        // matrix * shared matrix
+        uint64_t start = ofGetElapsedTimeMicros();
+        for ( size_t r=0; r<reps; r++ ) {
+            for ( size_t i=0; i<n; i++ ) {
+                multiplied[i] = matrices[i] * shared;
+            }
+            checksum += multiplied[r % n].getPtr()[0];
+        }
+        uint64_t referenceTime = ofGetElapsedTimeMicros() - start;
+
+        start = ofGetElapsedTimeMicros();
+        for ( size_t r=0; r<reps; r++ ) {
+            multiplyMatrices( matrixArray, shared, multipliedArray );
+            checksum += multipliedArray.m[0][r % n];
+        }
+        uint64_t batchedTime = ofGetElapsedTimeMicros() - start;
+
+        printf("%-20s %8lu %12.2f %12.2f %7.1fx\n", "multiplyMatrices", (unsigned long)n,
+               nsPer( referenceTime, n * reps ), nsPer( batchedTime, n * reps ), (double)referenceTime / MAX( batchedTime, (uint64_t)1 ) );
+
+        // point * matrix
+        start = ofGetElapsedTimeMicros();
+        for ( size_t r=0; r<reps; r++ ) {
+            for ( size_t i=0; i<n; i++ ) {
+                transformed[i] = shared.preMult( points[i] );
+            }
+            checksum += transformed[r % n].x;
+        }
+        referenceTime = ofGetElapsedTimeMicros() - start;
+
+        start = ofGetElapsedTimeMicros();
+        for ( size_t r=0; r<reps; r++ ) {
+            transformPoints( pointArray, shared, transformedArray );
+            checksum += transformedArray.x[r % n];
+        }
+        batchedTime = ofGetElapsedTimeMicros() - start;
+
+        printf("%-20s %8lu %12.2f %12.2f %7.1fx\n", "transformPoints", (unsigned long)n,
+               nsPer( referenceTime, n * reps ), nsPer( batchedTime, n * reps ), (double)referenceTime / MAX( batchedTime, (uint64_t)1 ) );
+    }
+
+    // inverse of a camera style matrix
+    const size_t numInverses = 1000000;
+    ofMatrix4x4 view;
+    view.makeLookAtViewMatrix( ofVec3f( 30.0f, 15.0f, 20.0f ), ofVec3f( 0.0f, 0.0f, 0.0f ), ofVec3f( 0.0f, 1.0f, 0.0f ) );
+
+    uint64_t start = ofGetElapsedTimeMicros();
+    for ( size_t i=0; i<numInverses; i++ ) {
+        view(3, 0) += 1e-6f; // stop the inverse being hoisted out of the loop
+        checksum += ofMatrix4x4::getInverseOf( view ).getPtr()[12];
+    }
+    uint64_t referenceTime = ofGetElapsedTimeMicros() - start;
+
+    start = ofGetElapsedTimeMicros();
+    for ( size_t i=0; i<numInverses; i++ ) {
+        view(3, 0) += 1e-6f;
+        checksum += getAffineInverse( view ).getPtr()[12];
+    }
+    uint64_t affineTime = ofGetElapsedTimeMicros() - start;
+
+    printf("%-20s %8lu %12.2f %12.2f %7.1fx\n", "getAffineInverse", (unsigned long)1,
+           nsPer( referenceTime, numInverses ), nsPer( affineTime, numInverses ), (double)referenceTime / MAX( affineTime, (uint64_t)1 ) );
+
+    printf("TransformMath: checksum %g\n", checksum );
+}
+
+}
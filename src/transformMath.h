@@ -0,0 +1,65 @@
+#pragma once
+
+//  TransformMath.h
+//
+//  Matrix helpers that avoid the general 4x4 paths in ofMatrix4x4, plus batched kernels that
+//  transform many matrices / points / bounding boxes at once. Batches are stored as structure of
+//  arrays (one float array per component) so SSE/AVX can work on 4/8 instances per instruction.
+//
+//  Conventions follow ofMatrix4x4 - row vectors (v' = v * M), so A * B applies A first and the
+//  translation lives in the last row. Element (row, col) of a matrix is getPtr()[row*4 + col].
+
+#include "ofMain.h"
+
+namespace TransformMath {
+
+    // inverse of an affine matrix (last column 0,0,0,1) - inverts the 3x3 part and the translation
+    // instead of the full 4x4. Falls back to ofMatrix4x4::getInverseOf() for projective matrices.
+    ofMatrix4x4 getAffineInverse( const ofMatrix4x4 &m );
+
+    // N 4x4 matrices - m[row*4 + col][i] is element (row, col) of matrix i
+    struct MatrixArray {
+        vector<float> m[16];
+
+        void    resize( size_t n );
+        size_t  size() const { return m[0].size(); }
+
+        void        set( size_t i, const ofMatrix4x4 &mat );
+        ofMatrix4x4 get( size_t i ) const;
+    };
+
+    // N points
+    struct PointArray {
+        vector<float> x, y, z;
+
+        void    resize( size_t n );
+        size_t  size() const { return x.size(); }
+
+        void    set( size_t i, const ofVec3f &p );
+        ofVec3f get( size_t i ) const;
+    };
+
+    // N axis aligned boxes stored as center + half extents
+    struct BoundsArray {
+        PointArray center;
+        PointArray extent;
+
+        void    resize( size_t n );
+        size_t  size() const { return center.size(); }
+    };
+
+    // out[i] = in[i] * mat - eg. model matrices into light or camera space. out is resized to match in
+    void multiplyMatrices( const MatrixArray &in, const ofMatrix4x4 &mat, MatrixArray &out );
+
+    // out[i] = in[i] * mat, mat must be affine (no perspective divide)
+    void transformPoints( const PointArray &in, const ofMatrix4x4 &mat, PointArray &out );
+
+    // bounding boxes of the transformed boxes (center * mat, extent * abs(mat)), mat must be affine
+    void transformBounds( const BoundsArray &in, const ofMatrix4x4 &mat, BoundsArray &out );
+
+    // compares the batched kernels and getAffineInverse() against ofMatrix4x4 on random data
+    bool runSelfTest();
+
+    // times the batched kernels against per-instance ofMatrix4x4 math and prints the results
+    void runBenchmarks();
+}